@@ -1,79 +1,339 @@
 #ifndef BUF_H
 #define BUF_H
 
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <deque>
+#include <set>
+#include <vector>
 #include "db.h"
+#include "stats.h"
 // define if debug output wanted
 //#define DEBUGBUF
 
-// declarations for buffer pool hash table
+// declarations for buffer pool hash table.  An entry with file == NULL
+// is empty.
 struct hashBucket
 {
 	File*	file;    // pointer a file object (more on this below)
 	int	pageNo;  // page number within a file
 	int	frameNo; // frame number of page in the buffer pool
-	hashBucket* 	next;	 // next node in the hash table
 };
 
 
-// hash table to keep track of pages in the buffer pool
+// hash table to keep track of pages in the buffer pool.
+// The table is split into NUMPARTITIONS independent partitions, each
+// protected by its own latch, so that threads working on different
+// pages rarely contend.  A (file,pageNo) pair always maps to the same
+// partition; callers that need a lookup and a following update to be
+// atomic hold partitionLatch(file,pageNo) around both calls.
+// Each partition is a flat open-addressing table with linear probing;
+// all memory is allocated by the constructor.
 class BufHashTbl
 {
 private:
-    int HTSIZE;
-    hashBucket**  ht; // actual hash table
-    int	 hash(const File* file, const int pageNo); // returns value between 0 and HTSIZE-1
+    static const int NUMPARTITIONS = 16; // must be a power of two
+
+    struct Partition {
+        std::mutex    latch;   // protects the buckets of this partition
+        hashBucket*   ht;      // actual hash table of this partition
+    };
+
+    unsigned int HTMASK;         // buckets per partition - 1
+    Partition part[NUMPARTITIONS];
+    unsigned long hashKey(const File* file, const int pageNo);
+    Partition& partitionOf(const unsigned long key)
+    {
+        return part[key >> 60 & (NUMPARTITIONS - 1)];
+    }
+    unsigned int hash(const unsigned long key) // returns value between 0 and HTMASK
+    {
+        return (key >> 32) & HTMASK;
+    }
+    int find(const hashBucket* ht, const File* file, const int pageNo,
+	     const unsigned long key); // bucket holding (file,pageNo) or -1
 
 public:
-    BufHashTbl(const int htSize);  // constructor
+    BufHashTbl(const int numEntries);  // constructor, sized for numEntries pages
     ~BufHashTbl(); // destructor
-	
+
+    // latch guarding the partition (file,pageNo) hashes to.  The
+    // insert/lookup/remove calls below do not take it themselves.
+    std::mutex& partitionLatch(const File* file, const int pageNo)
+    {
+        return partitionOf(hashKey(file, pageNo)).latch;
+    }
+
     // insert entry into hash table mapping (file,pageNo) to frameNo;
     // returns 0 if OK, HASHTBLERROR if an error occurred
   Status insert(const File* file, const int pageNo, const int frameNo);
 
     // Check if (file,pageNo) is currently in the buffer pool (ie. in
-    // the hash table).  If so, return corresponding frameNo. else return 
+    // the hash table).  If so, return corresponding frameNo. else return
     // HASHNOTFOUND
   Status lookup(const File* file, const int pageNo, int & frameNo);
 
     // delete entry (file,pageNo) from hash table. REturn OK if page was
     // found.  Else return HASHTBLERROR
-  Status remove(const File* file, const int pageNo);  
+  Status remove(const File* file, const int pageNo);
+};
+
+
+// page replacement policies a BufMgr can be created with
+enum ReplacePolicy { CLOCK, LRUK, TWOQ };
+
+// identifies a page independently of the frame it is in
+struct PageKey
+{
+  const File* file;
+  int	pageNo;
+
+  bool operator == (const PageKey & other) const
+    {
+      return file == other.file && pageNo == other.pageNo;
+    }
+};
+
+struct PageKeyHash
+{
+  size_t operator () (const PageKey & key) const
+    {
+      return ((size_t)key.file ^ (size_t)key.pageNo << 32 ^ key.pageNo)
+	* 0x9e3779b97f4a7c15UL;
+    }
+};
+
+// Bounded record of pages that recently left the pool, oldest dropped
+// first.  Used by the policies that remember non-resident pages.  Keys
+// taken back out stay in the FIFO until they reach its front; the
+// sequence number tells such stale keys apart from a later insert.
+template <class V>
+class PageHistory
+{
+private:
+  struct Entry {
+    V value;
+    unsigned long seq;
+  };
+  unsigned int capacity;
+  unsigned long seq;
+  std::unordered_map<PageKey, Entry, PageKeyHash> entries;
+  std::deque<std::pair<PageKey, unsigned long> > order;
+
+  void popOldest()
+    {
+      typename std::unordered_map<PageKey, Entry, PageKeyHash>::iterator it
+	= entries.find(order.front().first);
+      if (it != entries.end() && it->second.seq == order.front().second)
+	entries.erase(it);
+      order.pop_front();
+    }
+
+public:
+  PageHistory(const unsigned int cap) : capacity(cap), seq(0) {}
+
+  void insert(const PageKey & key, const V & value)
+    {
+      Entry e = { value, ++seq };
+      entries[key] = e;
+      order.push_back(std::make_pair(key, e.seq));
+      while (entries.size() > capacity || order.size() > 2 * capacity + 1)
+	popOldest();
+    }
+
+  // removes key; returns true and its value if it was present
+  bool take(const PageKey & key, V & value)
+    {
+      typename std::unordered_map<PageKey, Entry, PageKeyHash>::iterator it
+	= entries.find(key);
+      if (it == entries.end())
+	return false;
+      value = it->second.value;
+      entries.erase(it);
+      return true;
+    }
+};
+
+// Interface between BufMgr and a page replacement policy.  BufMgr
+// reports every page access and every page leaving the pool, and asks
+// for a victim when it needs a frame.  victim() walks the policy's
+// eviction order (free frames first) and returns the first frame for
+// which claim(frame) succeeds, or -1.  claim() pins the frame; the
+// policy must not be called back from inside it.
+class Replacer
+{
+public:
+  virtual ~Replacer() {}
+
+  // page (file,pageNo) in frame was referenced; miss is true when it
+  // has just been brought into the frame
+  virtual void accessed(const int frame, const File* file, const int pageNo,
+			const bool miss) = 0;
+
+  // page (file,pageNo) was read ahead into frame.  The first read of
+  // it (accessed with miss false) is correlated with the load: the two
+  // together count as one reference, at the time of the read
+  virtual void loaded(const int frame, const File* file, const int pageNo) = 0;
+
+  // the page in frame left the pool, or a claimed frame went unused
+  virtual void removed(const int frame) = 0;
+
+  virtual int victim(const std::function<bool(int)> & claim) = 0;
+
+  static Replacer* create(const ReplacePolicy policy, const int numBufs);
+};
+
+// Doubly linked lists threaded through per-frame prev/next arrays, so
+// the list-based policies never allocate on the hot path.  Every frame
+// is on at most one list at a time.
+class FrameLists
+{
+private:
+  std::vector<int> prev, next, owner;
+  std::vector<int> head, tail, len;
+
+public:
+  FrameLists(const int numBufs, const int numLists);
+
+  void pushFront(const int list, const int frame);  // most recent end
+  void unlink(const int frame);
+  int  listOf(const int frame) const { return owner[frame]; }  // -1 if none
+  int  back(const int list) const { return tail[list]; }       // least recent
+  int  before(const int frame) const { return prev[frame]; }   // towards front
+  int  size(const int list) const { return len[list]; }
+};
+
+// second-chance clock; reference bits are set without taking any latch
+// and the hand is advanced atomically
+class ClockReplacer : public Replacer
+{
+private:
+  int numBufs;
+  std::atomic<unsigned int> hand;
+  std::atomic<bool>* refbit;    // has the frame been referenced recently
+
+public:
+  ClockReplacer(const int bufs);
+  ~ClockReplacer();
+  void accessed(const int frame, const File* file, const int pageNo,
+		const bool miss);
+  void loaded(const int frame, const File* file, const int pageNo);
+  void removed(const int frame);
+  int victim(const std::function<bool(int)> & claim);
 };
 
+// LRU-K (O'Neil, O'Neil and Weikum): evicts the page whose K-th most
+// recent reference is oldest; pages seen fewer than K times go first.
+// Reference history outlives eviction for a pool's worth of pages.
+class LRUKReplacer : public Replacer
+{
+private:
+  static const int K = 2;
+  enum { FREE, CLAIMED, RESIDENT };
+  struct History {
+    unsigned long ref[K];       // ref[0] most recent, 0 = never
+  };
+
+  std::mutex latch;
+  unsigned long now;            // logical time, one tick per access
+  std::vector<History> hist;    // per frame
+  std::vector<PageKey> page;    // per frame
+  std::vector<char>    state;   // per frame
+  std::vector<char>    ahead;   // per frame, read ahead and not read since
+  std::vector<unsigned long> pushedOut; // per frame, oldest reference
+                                // before the read ahead shifted it out
+  std::vector<int>     freeFrames; // may hold frames no longer FREE
+  std::set<std::pair<unsigned long, int> > order; // (K-th ref, frame)
+  PageHistory<History> retained;
+
+  unsigned long rank(const History & h) const
+  {
+    // pages with fewer than K references are ranked by their last one,
+    // below every page with a full history
+    return h.ref[K - 1] ? h.ref[K - 1] + (1UL << 62) : h.ref[0];
+  }
 
-class BufMgr;  //forward declaration of BufMgr class 
+  void admit(const int frame, const File* file, const int pageNo);
+  void reference(const int frame);
 
-// class for maintaining information about buffer pool frames
+public:
+  LRUKReplacer(const int bufs);
+  void accessed(const int frame, const File* file, const int pageNo,
+		const bool miss);
+  void loaded(const int frame, const File* file, const int pageNo);
+  void removed(const int frame);
+  int victim(const std::function<bool(int)> & claim);
+};
+
+// 2Q (Johnson and Shasha, full version): first-time pages enter the A1in
+// FIFO; only pages referenced again after falling out of it (remembered
+// in the A1out ghost list) are admitted to the Am LRU list, so a scan
+// cannot push the hot set out.
+class TwoQReplacer : public Replacer
+{
+private:
+  enum { FREE, A1IN, AM };
+
+  std::mutex latch;
+  int kin;                      // target size of A1in
+  FrameLists lists;
+  std::vector<PageKey> page;    // per frame
+  PageHistory<bool> a1out;
+
+public:
+  TwoQReplacer(const int bufs);
+  void accessed(const int frame, const File* file, const int pageNo,
+		const bool miss);
+  void loaded(const int frame, const File* file, const int pageNo);
+  void removed(const int frame);
+  int victim(const std::function<bool(int)> & claim);
+};
+
+
+class BufMgr;  //forward declaration of BufMgr class
+
+// class for maintaining information about buffer pool frames.
+// pinCnt, dirty and valid are atomic so that they can be
+// read by the clock sweep without holding any latch.  file and pageNo
+// only change while the changing thread holds a pin on the frame and
+// the partition latch of the page.
 class BufDesc {
     friend class BufMgr;
 private:
   File* file;   // pointer to file object
   int   pageNo; // page within file
   int	frameNo;  // frame # of frame
-  int   pinCnt; // number of times this page has been pinned
-  bool 	dirty;	  // true if dirty;  false otherwise
-  bool 	valid;   // true if page is valid
-  bool  refbit;	 // has this buffer frame been reference recently
+  std::atomic<int>  pinCnt; // number of times this page has been pinned
+  std::atomic<bool> dirty;	  // true if dirty;  false otherwise
+  std::atomic<bool> valid;   // true if page is valid
+  std::atomic<bool> prefetched; // read ahead and not requested since
+  bool  passed;  // read ahead after the scan had already gone past it
+  std::shared_mutex latch; // held exclusive while the frame is being
+                           // filled from disk or written out
 
   void Clear() {  // initialize buffer frame for a new user
-    	pinCnt = 0;
 	file = NULL;
 	pageNo = -1;
     	dirty = false;
 	valid = false;
+	prefetched = false;
+	passed = false;
   };
 
-  void Set(File* filePtr, int pageNum) { 
+  void Set(File* filePtr, int pageNum) {
       file = filePtr;
       pageNo = pageNum;
       pinCnt = 1;
       dirty = false;
       valid = true;
-      refbit = true;
   }
 
-  BufDesc() {
+  BufDesc() : frameNo(0), pinCnt(0) {
       Clear();
   }
 };
@@ -81,62 +341,222 @@ private:
 
 struct BufStats
 {
-  int accesses;    // Total number of accesses to buffer pool
-  int diskreads;   // Number of pages read from disk (including allocs)
-  int diskwrites;  // Number of pages written back to disk
+  std::atomic<long> accesses;    // Total number of accesses to buffer pool
+  std::atomic<long> diskreads;   // Number of pages read from disk on demand (including allocs)
+  std::atomic<long> diskwrites;  // Number of pages written back to disk
+  std::atomic<long> bgwrites;    // Pages of those written by the background writer
+  std::atomic<long> prefetches;  // Pages read from disk ahead of demand
+  std::atomic<long> prefetchhits;   // Pages of those requested afterwards
+  std::atomic<long> prefetchwasted; // Pages of those dropped before any request
+  std::atomic<long> hits;        // readPage calls that found the page in the pool
+  std::atomic<long> evictions;   // Pages evicted to reuse their frame
+  std::atomic<long> dirtyevictions; // Pages of those written out by the evicting thread
+
+  // filled only while statistics are turned on, see stats.h
+  Histogram readHit;            // ns per readPage that found the page
+  Histogram readMiss;           // ns per readPage that read it from disk
+  Histogram sweep;              // frames allocBuf tried to claim per call
+  Histogram victimWrite;        // ns to write out a dirty victim
 
   void clear()
     {
-      accesses = diskreads = diskwrites = 0;
+      accesses = diskreads = diskwrites = bgwrites = 0;
+      prefetches = prefetchhits = prefetchwasted = 0;
+      hits = evictions = dirtyevictions = 0;
+      readHit.clear();
+      readMiss.clear();
+      sweep.clear();
+      victimWrite.clear();
     }
-      
+
   BufStats()
     {
       clear();
     }
 };
 
+// BufStats at one point in time
+struct BufStatsSnapshot
+{
+  long accesses, diskreads, diskwrites, bgwrites;
+  long prefetches, prefetchhits, prefetchwasted;
+  long hits, evictions, dirtyevictions;
+  HistogramSnapshot readHit, readMiss, sweep, victimWrite;
+
+  // in the format of stats.h, as minirel_buf_* samples
+  void dump(std::ostream & out, const std::string & labels = "") const;
+};
 
-class BufMgr 
+
+// The buffer manager may be used by several threads at once.  Each
+// thread must unpin exactly the pages it pinned; the contents of a
+// pinned page are not latched for the caller.
+//
+// There may be several buffer pools, each with its own size and
+// replacement policy.  A pool created with createPool has a name, and a
+// file opened with that name (DB::openFile) keeps its pages in that
+// pool only: whichever BufMgr is called for the file, the call is
+// passed on to the file's pool, which the File points to, so the global
+// bufMgr still serves every file.  Files opened without a pool name use
+// the BufMgr they are called on.  Close a pool's files before deleting it.
+class BufMgr
 {
 private:
-  unsigned int 	 clockHand;
   int   	 numBufs;    	// Number of pages in buffer pool
+  string	 name;		// name of the pool, empty if unnamed
+  int		 numaNode;	// node its memory is on, -1 if not placed
+  Replacer*	 replacer;	// chooses the frames to reuse
   BufHashTbl*    hashTable;  	// hash table mapping (File, page) to frame
   BufDesc*	 bufTable;  	// vector of status info, 1 per page
   BufStats	 bufStats;	// buffer pool statistics
+  size_t	 poolBytes;	// size of the arena holding bufPool
+  size_t	 tableBytes;	// size of the mapping holding bufTable
+
+  // the pool a call about file belongs to if not this one, else NULL
+  BufMgr* poolOf(const File* file) const
+  {
+	BufMgr* pool = file->pool;
+	return pool == this ? NULL : pool;
+  }
+
+  // bufPool is one arena aligned to a huge page, backed by huge pages
+  // where the system has them
+  static Page* allocPool(size_t & bytes);
 
-  const Status allocBuf(int & frame);   // allocate a free frame.  
+  const Status allocBuf(int & frame);   // allocate a free frame.
   const void releaseBuf(int frame); // return unused frame to end of list
-  void advanceClock()
+  const Status evictFrame(int frame); // write back and unmap a pinned frame
+  bool claimFrame(int frame)    // pin a frame nobody else has pinned
+  {
+	int unpinned = 0;
+	return bufTable[frame].pinCnt.compare_exchange_strong(unpinned, 1);
+  }
+  // latch a claimed frame exclusively; a reader that pins the page now
+  // waits before it gets to the page.  False, and not latched, if one
+  // pinned it between the claim and the latch and may be using it.
+  bool latchClaimed(int frame)
   {
-	clockHand = (clockHand + 1) % numBufs;
+	bufTable[frame].latch.lock();
+	if (bufTable[frame].pinCnt == 1)
+	    return true;
+	bufTable[frame].latch.unlock();
+	return false;
   }
 
+  // writes the pages of claimed and latched frames, sorted by (file,
+  // pageNo) and merged into runs, and marks those written clean
+  const Status writeFrames(std::vector<int> & frames, const bool background);
+
+  // background writer: keeps cleanTarget frames clean and unpinned
+  std::thread	 writer;
+  std::mutex	 writerLatch;	// held by a write-back pass and flushFile
+  std::condition_variable writerWake;
+  bool		 writerStop;
+  std::atomic<int> cleanTarget;	// 0 when there is no background writer
+  unsigned int	 writerHand;	// where the next pass starts looking
+  void writerLoop();
+  void writeBehind();
+
+  // read-ahead: sequential scans detected in readPage are handed to a
+  // prefetch thread as (file, first page, count) requests
+  struct PrefetchReq {
+    File* file;
+    int   first;
+    int   count;
+  };
+  std::thread	 prefetcher;
+  std::mutex	 prefetchLatch;	// protects the queue and prefetching
+  std::condition_variable prefetchWake;
+  std::deque<PrefetchReq> prefetchQueue;
+  File*		 prefetching;	// file of the request being served
+  bool		 prefetchStop;
+  std::atomic<int> maxReadAhead;	// largest window, 0 if read-ahead is off
+  void readAhead(File* file, const int pageNo);
+  void prefetchLoop();
+  void cancelPrefetch(const File* file);
+  void dropUnused(BufDesc & bufDesc); // account for a page read ahead in vain
+
+  // pages of MAPPED files never enter the pool; they are used in place
+  // and only their pins and dirty flags are tracked, by the File
+  const Status readMapped(File* file, const int pageNo, Page*& page);
+  const Status unPinMapped(File* file, const int pageNo, const bool dirty);
+  const Status allocMapped(File* file, int& pageNo, Page*& page);
+  const Status disposeMapped(File* file, const int pageNo);
+  const Status flushMapped(File* file);
+
 
 public:
   Page*	         bufPool;   // actual buffer pool
 
-  BufMgr(const int bufs);
+  // numaNode >= 0 asks for the frames and their descriptors to be
+  // allocated on that NUMA node, see getNumaNode
+  BufMgr(const int bufs, const ReplacePolicy policy = CLOCK,
+	 const int numaNode = -1);
   ~BufMgr();
 
+  // Create a pool that files can be opened into by name; POOLEXISTS if
+  // the name is empty or taken.  Deleting the pool frees the name.
+  static const Status createPool(const string & name, const int bufs,
+				 const ReplacePolicy policy, const int numaNode,
+				 BufMgr* & pool);
+  static const Status findPool(const string & name, BufMgr* & pool);
+  const string & getName() const
+  {
+	return name;
+  }
+  // the node the pool's memory was bound to, -1 if none was asked for
+  // or the system has no such node or no NUMA support
+  int getNumaNode() const
+  {
+	return numaNode;
+  }
+
   const Status readPage(File* file, const int PageNo, Page*& page);
   const Status unPinPage(File* file, const int PageNo, const bool dirty);
-  const Status allocPage(File* file, int& PageNo, Page*& page); 
-                        // allocates a new, empty page 
+  const Status allocPage(File* file, int& PageNo, Page*& page);
+                        // allocates a new, empty page
   const Status flushFile(const File* file); // writing out all dirty pages of the file
-  const Status disposePage(File* file, const int PageNo); // dispose of page in file
+  const Status disposePage(File* file, const int PageNo); // dispose of page in file,
+                        // PAGEPINNED if it is in use
   void  printSelf();
 
+  // Start a background thread that writes dirty pages ahead of eviction
+  // so that about cleanTarget frames are always clean and unpinned.
+  // While it runs, allocBuf prefers clean victims.
+  void startWriter(const int cleanTarget);
+  void stopWriter();
+
+  // Bring pages firstPage .. firstPage+count-1 of file into unpinned
+  // frames, reading each run of missing pages with a single preadv.
+  // Stops early at the end of the file or when no frame is free.
+  const Status prefetch(File* file, const int firstPage, const int count);
+
+  // Turn automatic read-ahead on (maxWindow > 0) or off (0).  When
+  // readPage sees a file being read in page order it prefetches ahead
+  // of the scan from a background thread, doubling the window up to
+  // maxWindow pages while the scan keeps consuming what was read ahead.
+  void setReadAhead(const int maxWindow);
+  // Wait until the prefetch thread has served every request queued so
+  // far, which makes what a scan reads ahead independent of timing.
+  void waitPrefetch();
+
   const BufStats & getBufStats() const // get buffer pool usage
   {
 	return bufStats;
   }
-  const void clearBufStats() 
+  const void clearBufStats()
   {
 	bufStats.clear();
   }
+
+  // Copy the statistics; with reset the counters and histograms are
+  // cleared as they are copied, so a scraper that resets each time sees
+  // exactly what happened since its last visit.
+  void snapshotBufStats(BufStatsSnapshot & snap, const bool reset = false);
+
+  // write a snapshot of the statistics in the format of stats.h,
+  // labelled with the pool name if the pool has one
+  void dumpStats(std::ostream & out, const bool reset = false);
 };
 
 #endif
-
@@ -0,0 +1,23 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+
+class Page;
+
+// CRC32C (Castagnoli) of len bytes.  Uses the SSE4.2 crc32 instruction
+// when the processor has it, a table-driven version otherwise.
+unsigned int crc32c(const void* data, size_t len);
+
+// Checksum of a page, without its last sizeof(int) bytes where the
+// checksum itself is kept (PAGECHECKSUM).  The page is cut into four
+// lanes whose CRC32Cs are computed side by side, which keeps the crc32
+// instruction busy, and then combined.
+unsigned int pageChecksum(const Page* page);
+
+// Use the hardware or the software CRC32C from now on, for tests and
+// benchmarks.  Returns whether the hardware one is in use, which it
+// cannot be where the processor lacks SSE4.2.
+bool setChecksumHardware(const bool hardware);
+
+#endif
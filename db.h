@@ -3,7 +3,13 @@
 
 #include <sys/types.h>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <set>
+#include <vector>
 #include "error.h"
+#include "stats.h"
 #include <string.h>
 using namespace std;
 
@@ -15,21 +21,140 @@ using namespace std;
 // forward class definition for db
 class DB;
 
+// how the pages of an open file are accessed
+enum FileMode {
+  BUFFERED,   // copied into BufMgr frames with pread/pwrite
+  MAPPED,     // used in place through a shared memory mapping
+  DIRECT      // like BUFFERED, but with O_DIRECT so that the kernel does
+              // not cache the pages as well; BUFFERED where not supported
+};
+
+// which pages read from disk have their checksum checked
+enum VerifyMode {
+  VERIFYALWAYS,   // every page
+  VERIFYSAMPLED,  // one page in VERIFYSAMPLE
+  VERIFYOFF       // none; checksums are still written
+};
+
+const unsigned int VERIFYSAMPLE = 16;
+
+// I/O statistics of an open file: system calls issued per operation and
+// the pages they moved
+struct IOStats
+{
+  std::atomic<long> preads;       // single page pread calls
+  std::atomic<long> pwrites;      // single page pwrite calls
+  std::atomic<long> preadvs;      // multi-page preadv calls
+  std::atomic<long> pwritevs;     // multi-page pwritev calls
+  std::atomic<long> pagesread;    // pages read by all of the above
+  std::atomic<long> pageswritten; // pages written by all of the above
+  std::atomic<long> msyncs;       // msync calls for runs of mapped pages
+  std::atomic<long> ftruncates;   // ftruncate calls growing the file
+  std::atomic<long> pagesverified; // pages read whose checksum was checked
+  std::atomic<long> badchecksums;  // pages of those that did not match
+
+  // filled only while statistics are turned on, see stats.h
+  Histogram readLatency;          // ns per single page read
+  Histogram writeLatency;         // ns per single page write
+
+  void clear()
+    {
+      preads = pwrites = preadvs = pwritevs = 0;
+      pagesread = pageswritten = 0;
+      msyncs = ftruncates = 0;
+      pagesverified = badchecksums = 0;
+      readLatency.clear();
+      writeLatency.clear();
+    }
+
+  long syscalls() const
+    {
+      return preads + pwrites + preadvs + pwritevs + msyncs + ftruncates;
+    }
+
+  IOStats()
+    {
+      clear();
+    }
+};
+
+// IOStats at one point in time
+struct IOStatsSnapshot
+{
+  long preads, pwrites, preadvs, pwritevs;
+  long pagesread, pageswritten;
+  long msyncs, ftruncates;
+  long pagesverified, badchecksums;
+  HistogramSnapshot readLatency, writeLatency;
+
+  // in the format of stats.h, as minirel_file_* samples
+  void dump(std::ostream & out, const std::string & labels = "") const;
+};
+
+class BufMgr;
+
 // class definition for open files
 class File {
   friend class DB;
   friend class OpenFileHashTbl;
+  friend class BufMgr;
 
  public:
 
   Status allocatePage(int& pageNo);     // allocate a new page
+  const Status allocatePages(const int count, int& firstPageNo);
+                                        // allocate count consecutive pages
   const Status disposePage(const int pageNo);       // release space for a page
   const Status readPage(const int pageNo,
 		  Page* pagePtr) const;       // read page from file
   const Status writePage(const int pageNo,
 		   const Page* pagePtr);      // write page to file
+  const Status readPages(const int pageNo, const int count,
+		  Page* const pagePtrs[], int& nread) const;
+                                      // read up to count consecutive pages
+                                      // in one call, fewer at end of file
+  const Status writePages(const int pageNo, const int count,
+		   const Page* const pagePtrs[]); // write count consecutive
+                                                  // pages in one call
   const Status getFirstPage(int& pageNo) const;     // returns pageNo of first page
 
+  FileMode getMode() const             // mode in effect, which is BUFFERED
+    {                                  // if DIRECT was asked for but the
+      return direct ? DIRECT : mode;   // file system refused O_DIRECT
+    }
+
+  // Checksums of the pages read from disk are checked according to the
+  // verify mode, VERIFYALWAYS when a file is opened.  A page that does
+  // not match is not used; the read returns BADCHECKSUM.  Pages of a
+  // MAPPED file are used in place and not checked.
+  void setVerify(const VerifyMode verifyMode)
+    {
+      verify = verifyMode;
+    }
+  VerifyMode getVerify() const
+    {
+      return verify;
+    }
+
+  const IOStats & getIOStats() const   // get I/O counters of this file
+    {
+      return ioStats;
+    }
+  void clearIOStats()
+    {
+      ioStats.clear();
+    }
+
+  // Copy the I/O statistics, clearing them as they are copied if reset
+  // is set, and write such a copy labelled with the file name.
+  void snapshotIOStats(IOStatsSnapshot & snap, const bool reset = false);
+  void dumpStats(std::ostream & out, const bool reset = false);
+
+  BufMgr* getPool() const              // pool the file was opened into,
+    {                                  // NULL if none was named
+      return pool;
+    }
+
   bool operator == (const File & other) const
     {
       return fileName == other.fileName;
@@ -43,13 +168,37 @@ class File {
   static const Status create(const string &fileName);
   static const Status destroy(const string &fileName);
 
-  const Status open();
+  const Status open(const FileMode mode);
   const Status close();
 
+  // memory mapped mode: the whole file is mapped at mapBase, inside an
+  // address range reserved when the file is opened so that growing the
+  // mapping never moves pages that are in use
+  const Status mapFile();
+  const Status growMap(const off_t fileSize);
+  Page* mappedPage(const int pageNo) const
+    {
+      return (Page*)(mapBase + (size_t)pageNo * sizeof(Page));
+    }
+
   const Status intread(const int pageNo,
 		 Page* pagePtr) const;        // internal file read
   const Status intwrite(const int pageNo,
 		  const Page* pagePtr);       // internal file write
+  bool dropDirect() const;              // turn O_DIRECT off after EINVAL
+  const Status verifyPage(const Page* pagePtr) const; // check a page read
+
+  // free space map, see db.C; the caller holds allocLatch
+  const Status loadFreeMap(const Page & header);
+  const Status writeFreeMap();          // write back header and FSM pages
+  const Status syncFreeMap();           // same, taking allocLatch itself
+  const Status extend(const int newNumPages);
+  int findFree(const int count) const;  // first run of count free pages
+  bool isFree(const int pageNo) const
+    {
+      return freeMap[pageNo / 64] >> (pageNo % 64) & 1;
+    }
+  void setFree(const int pageNo, const bool free);
 
 #ifdef DEBUGFREE
   void listFree();                      // list free pages
@@ -58,9 +207,39 @@ class File {
   string fileName;                    // The name of the file
   int openCnt;                        // # times file has been opened
   int unixFile;                       // unix file stream for file
+  mutable IOStats ioStats;            // system calls issued on unixFile
+  mutable std::mutex allocLatch;      // protects the allocation state
+  std::atomic<VerifyMode> verify;     // which pages read are checked
+  mutable std::atomic<unsigned int> readCount; // picks the pages sampled
+
+  // allocation state: the header page and free space map, read when the
+  // file is opened and kept here until it is closed
+  int numPages;                       // total # of pages in file
+  int firstPage;                      // page # of first page in file
+  int numFree;                        // pages marked free
+  std::vector<unsigned long> freeMap; // one bit per page, set if free
+  std::vector<bool> fsmDirty;         // FSM pages to write, 0 is the header
+  size_t freeHint;                    // no free page in words before it
+
+  // sequential access detection, maintained by the buffer manager
+  struct ReadAhead {
+    std::mutex latch;
+    int next;       // page expected next if a scan is under way
+    int end;        // last page already requested ahead
+    int window;     // pages to request ahead next time
+  } readAhead;
+
+  BufMgr* pool;                       // buffer pool of the pages, or NULL
+  FileMode mode;                      // BUFFERED or MAPPED
+  mutable std::atomic<bool> direct;   // unixFile has O_DIRECT set
+  char* mapBase;                      // start of the mapping, NULL unless MAPPED
+  size_t mapLen;                      // bytes of the reservation mapped so far
+  std::atomic<int> mapPages;          // pages of the file inside the mapping
+  std::mutex mapLatch;                // protects mapPins and mapDirty
+  std::unordered_map<int, int> mapPins; // pin count of mapped pages in use
+  std::set<int> mapDirty;             // mapped pages modified since last msync
 };
 
-class BufMgr;
 extern BufMgr* bufMgr;
 
 // declarations for hash table of open files
@@ -106,7 +285,10 @@ class DB {
   const Status createFile(const string & fileName) ;  // create a new file
   const Status destroyFile(const string & fileName) ; // destroy a file, 
                                                            // release all space
-  const Status openFile(const string & fileName, File* & file);  // open a file
+  const Status openFile(const string & fileName, File* & file,
+		  const FileMode mode = BUFFERED,   // open a file; mode and
+		  const string & pool = "");        // pool only matter on
+                                                    // first open, see BufMgr
   const Status closeFile(File* file);         // close a file
 
  private:
@@ -117,9 +299,10 @@ class DB {
 // structure of DB (header) page
 
 typedef struct {
-  int nextFree;                         // page # of next page on free list
+  int numFree;                          // # of pages marked free in the FSM
   int firstPage;                        // page # of first page in file
   int numPages;                         // total # of pages in file
+  int pageSize;                         // PAGESIZE the file was created with
 } DBPage;
 
 #endif
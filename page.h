@@ -17,21 +17,41 @@ struct Record
   int length;
 };
 
-// slot structure
+// slot structure; ints so that offsets reach across pages over 32 KB
 struct slot_t {
-        short	offset;  
-        short	length;  // equals -1 if slot is not in use
+        int	offset;  
+        int	length;  // equals -1 if slot is not in use
 };
 
-const unsigned PAGESIZE = 1024;
-const unsigned DPFIXED= sizeof(slot_t)+4*sizeof(short)+2*sizeof(int);
+// The page size is fixed when the system is compiled, e.g. with
+// -DMINIREL_PAGESIZE=8192 (the makefile's PAGESIZE variable).  It is
+// recorded in the header page of every file, and a file written with
+// another page size cannot be opened.
+#ifndef MINIREL_PAGESIZE
+#define MINIREL_PAGESIZE 1024
+#endif
+
+constexpr unsigned PAGESIZE = MINIREL_PAGESIZE;
+static_assert(PAGESIZE >= 1024 && PAGESIZE <= 65536
+	      && (PAGESIZE & (PAGESIZE - 1)) == 0,
+	      "page size must be a power of two from 1 KB to 64 KB");
+
+const unsigned DPFIXED= sizeof(slot_t)+5*sizeof(int)+sizeof(unsigned int);
 const unsigned PAGEDATASIZE = PAGESIZE-DPFIXED+sizeof(slot_t);
 // size of the data area of a page
 
+// The last bytes of every page hold its checksum (see checksum.h), set
+// by File when the page is written and checked when it is read back.
+// Data pages keep it in Page::checksum, the header and free space map
+// pages in the bytes they leave at their end.
+const unsigned PAGECHECKSUM = PAGESIZE - sizeof(unsigned int);
+
 // Class definition for a minirel data page.   
-// The design assumes that records are kept compacted when
-// deletions are performed. Notice, however, that the slot
-// array cannot be compacted.  Notice, this class does not keep
+// Deletions only free the slot; the hole a record leaves in data[] is
+// counted in freeSpace but reclaimed lazily, by compacting the records
+// when an insert or update needs more contiguous space than is left
+// between freePtr and the slot array.  Notice that the slot array
+// cannot be compacted.  Notice, this class does not keep
 // the records align, relying instead on upper levels to take
 // care of non-aligned attributes
 
@@ -39,12 +59,28 @@ class Page {
 private:
     char 	data[PAGESIZE - DPFIXED]; 
     slot_t 	slot[1]; // first element of slot array - grows backwards!
-    short	slotCnt; // number of slots in use;
-    short	freePtr; // offset of first free byte in data[]
-    short	freeSpace; // number of bytes free in data[]
-    short	dummy;	// for alignment purposes
+    int		slotCnt; // number of slots in use;
+    int		freePtr; // offset of first free byte in data[]
+    int		freeSpace; // number of bytes free in data[]
     int		nextPage; // forwards pointer
     int		curPage;  // page number of current pointer
+    unsigned int checksum; // at PAGECHECKSUM, belongs to File
+
+    // slot i, for i = 0, -1, -2, ...  The slot array grows down into
+    // data[], so it is addressed from the end of data[]; indexing
+    // slot[1] below 0 lets an optimizing compiler assume i == 0.
+    slot_t* slotAt(const int i)
+      { return (slot_t*)(data + sizeof data) + i; }
+    const slot_t* slotAt(const int i) const
+      { return (const slot_t*)(data + sizeof data) + i; }
+
+    // bytes between freePtr and the slot array when it has numSlots
+    // slots, counted the way freeSpace counts them
+    int gapSpace(const int numSlots) const
+      { return (int)sizeof data - freePtr - numSlots * (int)sizeof(slot_t); }
+
+    // slide the records to the front of data[], closing the holes
+    void compact();
 
 public:
     void init(const int pageNo); // initialize a new page
@@ -52,7 +88,7 @@ public:
 
     const Status getNextPage(int& pageNo) const; // returns value of nextPage
     const Status setNextPage(const int pageNo); // sets value of nextPage to pageNo
-    const short getFreeSpace() const; // returns amount of free space
+    const int getFreeSpace() const; // returns amount of free space
 
     // inserts a new record (rec) into the page, returns RID of record 
     const Status insertRecord(const Record & rec, RID& rid);
@@ -60,6 +96,11 @@ public:
     // delete the record with the specified rid
     const Status deleteRecord(const RID & rid);
 
+    // replace the record with the specified rid by rec, keeping its
+    // RID.  A record that is no longer than before is overwritten in
+    // place.  Returns NOSPACE if the page cannot hold the new record.
+    const Status updateRecord(const RID & rid, const Record & rec);
+
     // returns RID of first record on page
     // returns  NORECORDS if page contains no records.  Otherwise, returns OK
     const Status firstRecord(RID& firstRid) const;
@@ -70,6 +111,21 @@ public:
 
     // returns reference to record with RID rid
     const Status getRecord(const RID & rid, Record & rec);
+
+    // Batch scan: copies the slots of up to maxRecs records, starting
+    // at slot number nextSlot, to recs and their slot numbers to
+    // slotNos, in slot order.  Returns the number copied and advances
+    // nextSlot past the last slot looked at; the page has no more
+    // records when nextSlot reaches getSlotCnt().
+    int scanSlots(int& nextSlot, slot_t recs[], int slotNos[],
+		  const int maxRecs) const;
+
+    // number of slots, in use or not, and the record at an offset that
+    // scanSlots returned
+    int getSlotCnt() const { return -slotCnt; }
+    const char* recordAt(const int offset) const { return &data[offset]; }
 };
 
+static_assert(sizeof(Page) == PAGESIZE, "Page must fill exactly one disk page");
+
 #endif
@@ -0,0 +1,63 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <vector>
+#include "page.h"
+#include "buf.h"
+
+enum Datatype { STRING, INTEGER, FLOAT };	// attribute types
+enum Operator { LT, LTE, EQ, GTE, GT, NE };	// scan operators
+
+// A condition on the attribute at a fixed offset of every record:
+// record[offset .. offset+length) op value.  A record too short to hold
+// the attribute does not qualify.
+struct ScanPredicate {
+  int		offset;
+  int		length;
+  Datatype	type;
+  Operator	op;
+  std::vector<char> value;
+};
+
+// Scans the records of a file a batch at a time, following the page chain
+// from the first page through the buffer manager.  The live slots of a
+// page are collected with Page::scanSlots and each predicate is applied
+// to the whole batch, narrowing a selection vector, before the records
+// that satisfy all of them are handed out.
+class BatchScan
+{
+private:
+  File*		file;
+  Page*		curPage;	// pinned while its records are handed out
+  int		curPageNo;	// -1 before the first page and after the last
+  int		nextSlot;	// where scanSlots continues on curPage
+  bool		done;
+  std::vector<ScanPredicate> preds;
+  std::vector<slot_t> slots;	// the current batch
+  std::vector<int> slotNos;
+  std::vector<int> sel;		// indexes into the batch that qualify
+
+  const Status nextPage();
+  int filter(const ScanPredicate & pred, int n);
+
+public:
+  BatchScan(File* file);
+  ~BatchScan();
+
+  // Add a condition; length must be sizeof(int) or sizeof(float) for
+  // INTEGER and FLOAT attributes.  Returns BADSCANPARM otherwise.
+  const Status addPredicate(const int offset, const int length,
+			    const Datatype type, const Operator op,
+			    const void* value);
+
+  // Copy up to maxRecs qualifying records of one page, with their RIDs,
+  // to the caller's arrays.  The records point into the page, which
+  // stays pinned until the next call or endScan.  Returns FILEEOF when
+  // there are no more records.
+  const Status next(RID rids[], Record recs[], const int maxRecs, int& count);
+
+  // Unpin the current page; the scan can start over with next.
+  const Status endScan();
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Instrumentation shared by BufMgr and File: latency and length
+// histograms, and the text format they are dumped in.
+//
+// Counters in BufStats and IOStats are always kept.  Histograms are only
+// filled while statistics are turned on with setStatsEnabled, off by
+// default, so that a disabled build reads no clock and touches no
+// histogram: the check is one relaxed load.  Compiling with
+// -DMINIREL_NOSTATS (STATSFLAGS in the makefile) removes the check and
+// the code behind it altogether.
+
+#ifdef MINIREL_NOSTATS
+inline bool statsEnabled() { return false; }
+inline void setStatsEnabled(const bool) {}
+#else
+extern std::atomic<bool> statsOn;
+inline bool statsEnabled() { return statsOn.load(std::memory_order_relaxed); }
+inline void setStatsEnabled(const bool on) { statsOn = on; }
+#endif
+
+// A copy of a Histogram taken at one point in time.
+struct HistogramSnapshot
+{
+  unsigned long count;          // values recorded
+  unsigned long sum;            // of the values
+  unsigned long max;            // largest value, 0 if none
+  std::vector<unsigned long> buckets;
+
+  HistogramSnapshot() : count(0), sum(0), max(0) {}
+
+  // smallest value that fraction p (0 .. 1) of the values do not exceed,
+  // to within the bucket resolution; 0 if nothing was recorded
+  unsigned long percentile(const double p) const;
+
+  // add the values of another snapshot, e.g. of another file
+  void merge(const HistogramSnapshot & other);
+
+  // append as a Prometheus summary: quantiles, _sum, _count and _max
+  void dump(std::ostream & out, const std::string & name,
+	    const std::string & labels) const;
+};
+
+// Histogram of unsigned 64-bit values in the manner of HdrHistogram:
+// values below 2 * SUBBUCKETS have a bucket each, larger ones share a
+// bucket with the values that agree in their SUBBITS + 1 leading bits,
+// so any value is known to within 1 / SUBBUCKETS.  The buckets are fixed
+// and every update is a few relaxed atomic additions, so threads record
+// without taking a latch.
+class Histogram
+{
+public:
+  static const int SUBBITS = 4;
+  static const int SUBBUCKETS = 1 << SUBBITS;
+  static const int NUMBUCKETS = (64 - SUBBITS + 1) * SUBBUCKETS;
+
+  Histogram();
+
+  // record value if statistics are turned on
+  void record(const unsigned long value)
+    {
+      if (statsEnabled())
+	add(value);
+    }
+  void add(const unsigned long value); // record regardless
+
+  // copy the histogram; with reset it is emptied as it is copied, so
+  // that no value recorded meanwhile is lost
+  void snapshot(HistogramSnapshot & snap, const bool reset = false);
+  void clear();
+
+  static int bucketOf(const unsigned long value);
+  static unsigned long highestIn(const int bucket); // largest value in it
+
+private:
+  std::atomic<unsigned long> buckets[NUMBUCKETS];
+  std::atomic<unsigned long> count;
+  std::atomic<unsigned long> sum;
+  std::atomic<unsigned long> max;
+};
+
+// Times an operation in nanoseconds into a histogram.  Reads the clock
+// only while statistics are turned on.
+class StatTimer
+{
+public:
+  StatTimer() : begin(statsEnabled() ? now() : 0) {}
+
+  void stop(Histogram & hist)
+    {
+      if (begin)
+	hist.add(now() - begin);
+    }
+
+private:
+  unsigned long begin;
+
+  static unsigned long now()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// value of a counter for a snapshot, cleared as it is read if reset
+inline long statsTake(std::atomic<long> & counter, const bool reset)
+{
+  return reset ? counter.exchange(0) : counter.load();
+}
+
+// append a counter in the same format as HistogramSnapshot::dump
+void dumpCounter(std::ostream & out, const std::string & name,
+		 const std::string & labels, const unsigned long value);
+
+// label="value" with the value escaped as the text format requires
+std::string statsLabel(const std::string & label, const std::string & value);
+
+#endif